@@ -6,9 +6,18 @@
 #include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
 #include <string.h>
 #include <pthread.h>
 #include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 /* GIF File Header Structures */
 #pragma pack(push, 1)
@@ -67,6 +76,20 @@ typedef struct {
 /* Number of threads to use for image processing */
 #define NUM_THREADS 4
 
+/* Playlist defaults: seconds between GIFs and file cache size in megabytes */
+#define DEFAULT_ROTATE_INTERVAL 300
+#define DEFAULT_CACHE_BUDGET_MB 64
+
+/* Rows per damage rectangle in desktop window output */
+#define DAMAGE_BAND_HEIGHT 64
+
+/* Frames smaller than this many pixels are composited on the calling thread */
+#define MIN_PARALLEL_PIXELS (256 * 256)
+
+/* GIF disposal methods */
+#define DISPOSE_BACKGROUND 2
+#define DISPOSE_PREVIOUS 3
+
 /* Enumeration for Display Modes */
 typedef enum {
     STRETCH,
@@ -94,6 +117,69 @@ typedef struct {
     uint8_t transparentColorIndex;
 } GraphicControlExtensionData;
 
+/* Canvas region covered by one frame */
+typedef struct {
+    int left;
+    int top;
+    int width;
+    int height;
+} FrameRect;
+
+/* Structure to pass a stripe of frame rows to compositing threads */
+typedef struct {
+    uint8_t *canvas;
+    int canvasWidth;
+    uint8_t *pixels;
+    int pixelsWidth;
+    FrameRect rect;
+    ColorTableEntry *colorTable;
+    int transparentIndex;   /* -1 when the frame has no transparency */
+    int startRow;
+    int endRow;
+} CompositeData;
+
+/* Decoding state of one open GIF */
+typedef struct {
+    FILE *fp;
+    uint8_t *fileData;      /* in-memory copy of the file, NULL when streaming from disk */
+    size_t fileSize;
+    long dataStart;         /* offset of the first block after the color table */
+    int width;
+    int height;
+    ColorTableEntry *globalColorTable;
+    ColorTableEntry background;
+    uint8_t *frameBuffer;   /* RGB canvas */
+    uint8_t *restoreBuffer; /* canvas under the last frame when it restores to previous */
+    size_t restoreSize;
+    int pendingDisposal;    /* disposal method of the last frame, applied before the next */
+    FrameRect pendingRect;
+    GraphicControlExtensionData gceData;
+    int hasGCE;
+    int frameDelay;
+} GifDecoder;
+
+/* GIF files to rotate through */
+typedef struct {
+    char **paths;
+    int count;
+} Playlist;
+
+/* Background load of the next GIF in the playlist */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int active;             /* thread started and not yet joined */
+    int done;
+    int failed;
+    const char *filename;
+    size_t cacheBudget;
+    GifDecoder gif;
+    uint32_t *dst;          /* pre-rendered first frame */
+    int destWidth;
+    int destHeight;
+    DisplayMode mode;
+} Prefetch;
+
 /* Helper Functions */
 uint16_t read_le_uint16(FILE *fp) {
     uint8_t bytes[2];
@@ -314,166 +400,220 @@ void *bilinear_thread_func(void *arg) {
     pthread_exit(NULL);
 }
 
-/* Helper function to get current time in milliseconds */
-uint64_t get_current_time_ms() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)(ts.tv_sec) * 1000 + (ts.tv_nsec) / 1000000;
+void gif_close(GifDecoder *gif) {
+    if (gif->fp) {
+        fclose(gif->fp);
+    }
+    free(gif->fileData);
+    free(gif->globalColorTable);
+    free(gif->restoreBuffer);
+    free(gif->frameBuffer);
+    memset(gif, 0, sizeof(GifDecoder));
 }
 
-/* Main Program */
-int main(int argc, char *argv[]) {
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "usage: %s <animated-gif-file> [stretch|center|tile]\n", argv[0]);
-        exit(1);
-    }
+/* Thread function that draws a stripe of frame rows onto the canvas */
+void *composite_thread_func(void *arg) {
+    CompositeData *data = (CompositeData *)arg;
+    FrameRect *rect = &data->rect;
 
-    const char *filename = argv[1];
-    DisplayMode mode = STRETCH; // Default display mode
+    for (int y = data->startRow; y < data->endRow; y++) {
+        uint8_t *src = data->pixels + y * data->pixelsWidth;
+        uint8_t *dst = data->canvas + ((rect->top + y) * data->canvasWidth + rect->left) * 3;
 
-    if (argc == 3) {
-        if (strcmp(argv[2], "stretch") == 0) {
-            mode = STRETCH;
-        } else if (strcmp(argv[2], "center") == 0) {
-            mode = CENTER;
-        } else if (strcmp(argv[2], "tile") == 0) {
-            mode = TILE;
-        } else {
-            fprintf(stderr, "Invalid display mode. Choose from stretch, center, or tile.\n");
-            exit(1);
+        for (int x = 0; x < rect->width; x++) {
+            int colorIndex = src[x];
+
+            /* Transparent pixels leave the canvas untouched */
+            if (colorIndex == data->transparentIndex) continue;
+
+            ColorTableEntry color = data->colorTable[colorIndex];
+            dst[x * 3] = color.red;
+            dst[x * 3 + 1] = color.green;
+            dst[x * 3 + 2] = color.blue;
         }
     }
 
-    FILE *gifFile = fopen(filename, "rb");
-    if (!gifFile) {
-        fprintf(stderr, "Could not open GIF file %s\n", filename);
-        exit(1);
-    }
+    return NULL;
+}
 
-    /* Read GIF Header */
-    GIFHeader header;
-    fread(&header, sizeof(GIFHeader), 1, gifFile);
-    if (strncmp(header.signature, "GIF", 3) != 0) {
-        fprintf(stderr, "Invalid GIF file\n");
-        fclose(gifFile);
-        exit(1);
-    }
+/* Draw a frame onto the canvas, split into row stripes for large frames */
+void composite_frame(CompositeData *composite) {
+    FrameRect *rect = &composite->rect;
 
-    /* Read Logical Screen Descriptor */
-    LogicalScreenDescriptor lsd;
-    fread(&lsd, sizeof(LogicalScreenDescriptor), 1, gifFile);
-    int gifWidth = lsd.width;
-    int gifHeight = lsd.height;
+    if (rect->width * rect->height < MIN_PARALLEL_PIXELS) {
+        composite->startRow = 0;
+        composite->endRow = rect->height;
+        composite_thread_func(composite);
+        return;
+    }
 
-    /* Check for Global Color Table */
-    int globalColorTableFlag = (lsd.packed & 0x80) >> 7;
-    int globalColorTableSize = 1 << ((lsd.packed & 0x07) + 1);
+    pthread_t threads[NUM_THREADS];
+    CompositeData threadData[NUM_THREADS];
+    int rowsPerThread = rect->height / NUM_THREADS;
 
-    /* Read Global Color Table */
-    ColorTableEntry *globalColorTable = NULL;
-    if (globalColorTableFlag) {
-        globalColorTable = malloc(sizeof(ColorTableEntry) * globalColorTableSize);
-        fread(globalColorTable, sizeof(ColorTableEntry), globalColorTableSize, gifFile);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        threadData[i] = *composite;
+        threadData[i].startRow = i * rowsPerThread;
+        threadData[i].endRow = (i == NUM_THREADS - 1) ? rect->height : threadData[i].startRow + rowsPerThread;
+        pthread_create(&threads[i], NULL, composite_thread_func, (void *)&threadData[i]);
     }
 
-    /* Initialize X11 */
-    Display *display = XOpenDisplay(NULL);
-    if (!display) {
-        fprintf(stderr, "Could not open X display\n");
-        fclose(gifFile);
-        free(globalColorTable);
-        exit(1);
+    /* Wait for all threads to complete */
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
     }
+}
 
-    int screen = DefaultScreen(display);
-    Window root = RootWindow(display, screen);
-    GC gc = DefaultGC(display, screen);
+/* Save the canvas under a frame that restores to previous. Only the
+   frame's own rectangle is kept, not the whole canvas. */
+int snapshot_rect(GifDecoder *gif, FrameRect *rect) {
+    size_t rowBytes = rect->width * 3;
+    size_t size = rowBytes * rect->height;
+
+    if (size > gif->restoreSize) {
+        uint8_t *buffer = realloc(gif->restoreBuffer, size);
+        if (!buffer) {
+            fprintf(stderr, "Failed to allocate restore buffer\n");
+            return -1;
+        }
+        gif->restoreBuffer = buffer;
+        gif->restoreSize = size;
+    }
 
-    /* Get Screen Dimensions */
-    int screenWidth = DisplayWidth(display, screen);
-    int screenHeight = DisplayHeight(display, screen);
+    for (int y = 0; y < rect->height; y++) {
+        memcpy(gif->restoreBuffer + y * rowBytes,
+               gif->frameBuffer + ((rect->top + y) * gif->width + rect->left) * 3, rowBytes);
+    }
+    return 0;
+}
 
-    XVisualInfo vinfo;
-    if (!XMatchVisualInfo(display, screen, 24, TrueColor, &vinfo)) {
-        fprintf(stderr, "No matching visual\n");
-        XCloseDisplay(display);
-        fclose(gifFile);
-        free(globalColorTable);
-        exit(1);
+/* Apply the disposal method of the last frame to its rectangle */
+void apply_disposal(GifDecoder *gif) {
+    FrameRect *rect = &gif->pendingRect;
+    size_t rowBytes = rect->width * 3;
+
+    if (gif->pendingDisposal == DISPOSE_BACKGROUND) {
+        ColorTableEntry bg = gif->background;
+        for (int y = 0; y < rect->height; y++) {
+            uint8_t *dst = gif->frameBuffer + ((rect->top + y) * gif->width + rect->left) * 3;
+            for (int x = 0; x < rect->width; x++) {
+                dst[x * 3] = bg.red;
+                dst[x * 3 + 1] = bg.green;
+                dst[x * 3 + 2] = bg.blue;
+            }
+        }
+    } else if (gif->pendingDisposal == DISPOSE_PREVIOUS) {
+        for (int y = 0; y < rect->height; y++) {
+            memcpy(gif->frameBuffer + ((rect->top + y) * gif->width + rect->left) * 3,
+                   gif->restoreBuffer + y * rowBytes, rowBytes);
+        }
     }
 
-    Visual *visual = vinfo.visual;
+    /* Methods 0 and 1 leave the frame in place */
+    gif->pendingDisposal = 0;
+}
 
-    /* Adjust image size based on display mode */
-    int destWidth = screenWidth;
-    int destHeight = screenHeight;
-    int offsetX = 0;
-    int offsetY = 0;
+/* Bytes of the GIF file held in memory */
+size_t gif_cached_size(GifDecoder *gif) {
+    return gif->fileData ? gif->fileSize : 0;
+}
 
-    if (mode == STRETCH) {
-        destWidth = screenWidth;
-        destHeight = screenHeight;
-    } else if (mode == CENTER) {
-        destWidth = gifWidth;
-        destHeight = gifHeight;
-        offsetX = (screenWidth - gifWidth) / 2;
-        offsetY = (screenHeight - gifHeight) / 2;
-    } else if (mode == TILE) {
-        destWidth = screenWidth;
-        destHeight = screenHeight;
+/* Open a GIF and parse everything up to the first block.
+   Files that fit within cacheBudget bytes are read fully into memory so
+   the decode loop never touches the disk. */
+int gif_open(GifDecoder *gif, const char *filename, size_t cacheBudget) {
+    memset(gif, 0, sizeof(GifDecoder));
+    gif->frameDelay = 100; // default delay in milliseconds
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Could not open GIF file %s\n", filename);
+        return -1;
     }
 
-    XImage *ximage = XCreateImage(display, visual, vinfo.depth, ZPixmap, 0,
-                                  NULL, destWidth, destHeight, 32, 0);
-    if (!ximage) {
-        fprintf(stderr, "Could not create XImage\n");
-        XCloseDisplay(display);
-        fclose(gifFile);
-        free(globalColorTable);
-        exit(1);
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && (size_t)st.st_size <= cacheBudget) {
+        gif->fileSize = st.st_size;
+        gif->fileData = malloc(gif->fileSize);
+        if (gif->fileData && fread(gif->fileData, 1, gif->fileSize, fp) == gif->fileSize) {
+            fclose(fp);
+            fp = fmemopen(gif->fileData, gif->fileSize, "rb");
+            if (!fp) {
+                fprintf(stderr, "Could not cache GIF file %s\n", filename);
+                free(gif->fileData);
+                gif->fileData = NULL;
+                return -1;
+            }
+        } else {
+            /* Fall back to streaming from disk */
+            free(gif->fileData);
+            gif->fileData = NULL;
+            rewind(fp);
+        }
     }
+    gif->fp = fp;
 
-    ximage->data = malloc(ximage->height * ximage->bytes_per_line);
-    if (!ximage->data) {
-        fprintf(stderr, "Could not allocate memory for XImage\n");
-        XDestroyImage(ximage);
-        XCloseDisplay(display);
-        fclose(gifFile);
-        free(globalColorTable);
-        exit(1);
+    /* Read GIF Header */
+    GIFHeader header;
+    if (fread(&header, sizeof(GIFHeader), 1, fp) != 1 || strncmp(header.signature, "GIF", 3) != 0) {
+        fprintf(stderr, "Invalid GIF file %s\n", filename);
+        gif_close(gif);
+        return -1;
     }
 
-    uint8_t *frameBuffer = malloc(gifWidth * gifHeight * 3);
-    if (!frameBuffer) {
-        fprintf(stderr, "Could not allocate memory for frame buffer\n");
-        free(ximage->data);
-        XDestroyImage(ximage);
-        XCloseDisplay(display);
-        fclose(gifFile);
-        free(globalColorTable);
-        exit(1);
+    /* Read Logical Screen Descriptor */
+    LogicalScreenDescriptor lsd;
+    fread(&lsd, sizeof(LogicalScreenDescriptor), 1, fp);
+    gif->width = lsd.width;
+    gif->height = lsd.height;
+
+    /* Read Global Color Table, sized for any 8-bit index */
+    if (lsd.packed & 0x80) {
+        int globalColorTableSize = 1 << ((lsd.packed & 0x07) + 1);
+        gif->globalColorTable = calloc(256, sizeof(ColorTableEntry));
+        if (gif->globalColorTable) {
+            fread(gif->globalColorTable, sizeof(ColorTableEntry), globalColorTableSize, fp);
+            gif->background = gif->globalColorTable[lsd.bgColorIndex];
+        }
     }
+    gif->dataStart = ftell(fp);
 
-    /* Variables for transparency and interlacing */
-    GraphicControlExtensionData gceData = {0, 0, 0};
-    int hasGCE = 0;
+    /* Start from a canvas cleared to the background color */
+    gif->pendingDisposal = DISPOSE_BACKGROUND;
+    gif->pendingRect = (FrameRect){0, 0, gif->width, gif->height};
 
-    /* Main Loop to Read Frames */
-    int running = 1;
-    int frameDelay = 100; // default delay in milliseconds
-    uint8_t *prevFrame = calloc(gifWidth * gifHeight, sizeof(uint8_t));
-    memset(prevFrame, 0, gifWidth * gifHeight);
+    gif->frameBuffer = malloc(gif->width * gif->height * 3);
+    if (!gif->frameBuffer) {
+        fprintf(stderr, "Could not allocate memory for frame buffer\n");
+        gif_close(gif);
+        return -1;
+    }
 
-    while (running) {
-        uint64_t frameStartTime = get_current_time_ms();
+    return 0;
+}
 
+/* Read blocks until the next image has been composited into frameBuffer.
+   Loops back to the first frame at the trailer. */
+int gif_next_frame(GifDecoder *gif) {
+    FILE *gifFile = gif->fp;
+    int gifWidth = gif->width;
+    int gifHeight = gif->height;
+    int rewinds = 0;
+
+    while (1) {
         int c = fgetc(gifFile);
-        if (c == EOF) {
-            /* Rewind to start */
-            fseek(gifFile, sizeof(GIFHeader) + sizeof(LogicalScreenDescriptor), SEEK_SET);
-            if (globalColorTableFlag) {
-                fseek(gifFile, sizeof(ColorTableEntry) * globalColorTableSize, SEEK_CUR);
+        if (c == EOF || c == 0x3B) {
+            /* GIF Trailer */
+            /* Loop back to start */
+            if (++rewinds > 1) {
+                fprintf(stderr, "No image data found in GIF\n");
+                return -1;
             }
+            fseek(gifFile, gif->dataStart, SEEK_SET);
+
+            /* Each loop starts again from a cleared canvas */
+            gif->pendingDisposal = DISPOSE_BACKGROUND;
+            gif->pendingRect = (FrameRect){0, 0, gifWidth, gifHeight};
             continue;
         }
 
@@ -494,9 +634,16 @@ int main(int argc, char *argv[]) {
             int localColorTableFlag = (id.packed & 0x80) >> 7;
             int localColorTableSize = 1 << ((id.packed & 0x07) + 1);
 
-            ColorTableEntry *colorTable = globalColorTable;
+            ColorTableEntry *colorTable = gif->globalColorTable;
             if (localColorTableFlag) {
-                colorTable = malloc(sizeof(ColorTableEntry) * localColorTableSize);
+                colorTable = calloc(256, sizeof(ColorTableEntry));
+                if (!colorTable) {
+                    fprintf(stderr, "Failed to allocate local color table\n");
+                    /* Skip the table and image data to stay on the next block */
+                    fseek(gifFile, sizeof(ColorTableEntry) * localColorTableSize + 1, SEEK_CUR);
+                    skip_sub_blocks(gifFile);
+                    continue;
+                }
                 fread(colorTable, sizeof(ColorTableEntry), localColorTableSize, gifFile);
             }
 
@@ -514,6 +661,9 @@ int main(int argc, char *argv[]) {
             if (!pixelIndices) {
                 fprintf(stderr, "Failed to allocate pixel indices\n");
                 free(compressedData);
+                if (localColorTableFlag) {
+                    free(colorTable);
+                }
                 continue;
             }
             lzw_decode(compressedData, compressedSize, pixelIndices, id.width, id.height, lzwMinCodeSize);
@@ -526,137 +676,48 @@ int main(int argc, char *argv[]) {
                 free(pixelIndices);
             }
 
-            /* Build Frame Buffer */
-            for (int y = 0; y < gifHeight; y++) {
-                for (int x = 0; x < gifWidth; x++) {
-                    int idx = y * gifWidth + x;
-                    uint8_t colorIndex;
-
-                    if (x >= id.left && x < id.left + id.width && y >= id.top && y < id.top + id.height) {
-                        int imgX = x - id.left;
-                        int imgY = y - id.top;
-                        colorIndex = decodedPixels[imgY * id.width + imgX];
-
-                        /* Handle Transparency */
-                        if (hasGCE && gceData.transparencyFlag && colorIndex == gceData.transparentColorIndex) {
-                            colorIndex = prevFrame[idx]; // Use previous frame pixel
-                        } else {
-                            prevFrame[idx] = colorIndex;
-                        }
-                    } else {
-                        colorIndex = prevFrame[idx];
-                    }
+            /* Undo the previous frame as its disposal method asks */
+            apply_disposal(gif);
 
-                    ColorTableEntry color = colorTable[colorIndex];
-                    int fbIdx = idx * 3;
-                    frameBuffer[fbIdx] = color.red;
-                    frameBuffer[fbIdx + 1] = color.green;
-                    frameBuffer[fbIdx + 2] = color.blue;
-                }
-            }
-
-            /* Reset GCE data */
-            hasGCE = 0;
-
-            /* Resize and Position Frame Buffer Based on Mode */
-            uint32_t *dst = (uint32_t *)ximage->data;
-            memset(dst, 0, ximage->height * ximage->bytes_per_line); // Clear the image
-
-            if (mode == STRETCH) {
-                /* Multithreaded bilinear interpolation */
-                pthread_t threads[NUM_THREADS];
-                ThreadData threadData[NUM_THREADS];
-                int rowsPerThread = destHeight / NUM_THREADS;
-
-                for (int i = 0; i < NUM_THREADS; i++) {
-                    threadData[i].thread_id = i;
-                    threadData[i].dst = dst;
-                    threadData[i].frameBuffer = frameBuffer;
-                    threadData[i].destWidth = destWidth;
-                    threadData[i].destHeight = destHeight;
-                    threadData[i].gifWidth = gifWidth;
-                    threadData[i].gifHeight = gifHeight;
-                    threadData[i].startRow = i * rowsPerThread;
-                    threadData[i].endRow = (i == NUM_THREADS - 1) ? destHeight : threadData[i].startRow + rowsPerThread;
-                    pthread_create(&threads[i], NULL, bilinear_thread_func, (void *)&threadData[i]);
-                }
+            /* Clip the frame to the canvas */
+            FrameRect rect;
+            rect.left = id.left < gifWidth ? id.left : gifWidth;
+            rect.top = id.top < gifHeight ? id.top : gifHeight;
+            rect.width = (id.left + id.width < gifWidth ? id.left + id.width : gifWidth) - rect.left;
+            rect.height = (id.top + id.height < gifHeight ? id.top + id.height : gifHeight) - rect.top;
 
-                /* Wait for all threads to complete */
-                for (int i = 0; i < NUM_THREADS; i++) {
-                    pthread_join(threads[i], NULL);
-                }
-
-            } else if (mode == CENTER) {
-                /* Center the image */
-                for (int y = 0; y < gifHeight; y++) {
-                    for (int x = 0; x < gifWidth; x++) {
-                        int srcIdx = (y * gifWidth + x) * 3;
-                        uint8_t r = frameBuffer[srcIdx];
-                        uint8_t g = frameBuffer[srcIdx + 1];
-                        uint8_t b = frameBuffer[srcIdx + 2];
-                        int dstX = x + offsetX;
-                        int dstY = y + offsetY;
-                        if (dstX >= 0 && dstX < destWidth && dstY >= 0 && dstY < destHeight) {
-                            int dstIdx = dstY * destWidth + dstX;
-                            dst[dstIdx] = (r << 16) | (g << 8) | b;
-                        }
-                    }
-                }
-            } else if (mode == TILE) {
-                /* Tile the image across the screen */
-                for (int y = 0; y < destHeight; y++) {
-                    for (int x = 0; x < destWidth; x++) {
-                        int srcX = x % gifWidth;
-                        int srcY = y % gifHeight;
-                        int srcIdx = (srcY * gifWidth + srcX) * 3;
-                        uint8_t r = frameBuffer[srcIdx];
-                        uint8_t g = frameBuffer[srcIdx + 1];
-                        uint8_t b = frameBuffer[srcIdx + 2];
-                        int dstIdx = y * destWidth + x;
-                        dst[dstIdx] = (r << 16) | (g << 8) | b;
-                    }
-                }
+            int disposalMethod = gif->hasGCE ? gif->gceData.disposalMethod : 0;
+            if (disposalMethod == DISPOSE_PREVIOUS && snapshot_rect(gif, &rect) != 0) {
+                disposalMethod = 0;
             }
 
-            /* Create pixmap from ximage */
-            Pixmap pixmap = XCreatePixmap(display, root, destWidth, destHeight, vinfo.depth);
-            XPutImage(display, pixmap, gc, ximage, 0, 0, 0, 0, destWidth, destHeight);
-
-            /* Set root window background pixmap */
-            XSetWindowBackgroundPixmap(display, root, pixmap);
-
-            /* Clear root window */
-            XClearWindow(display, root);
-
-            /* Remove old pixmap */
-            XFreePixmap(display, pixmap);
-
-            /* Flush changes */
-            XFlush(display);
-
-            /* Calculate processing time */
-            uint64_t frameEndTime = get_current_time_ms();
-            uint64_t processingTime = frameEndTime - frameStartTime;
-
-            /* Adjust frame delay */
-            int adjustedDelay = frameDelay - (int)processingTime;
-            if (adjustedDelay < 0) {
-                adjustedDelay = 0; // Prevent negative delay
+            /* Build Frame Buffer */
+            if (colorTable) {
+                CompositeData composite;
+                composite.canvas = gif->frameBuffer;
+                composite.canvasWidth = gifWidth;
+                composite.pixels = decodedPixels;
+                composite.pixelsWidth = id.width;
+                composite.rect = rect;
+                composite.colorTable = colorTable;
+                composite.transparentIndex = (gif->hasGCE && gif->gceData.transparencyFlag) ? gif->gceData.transparentColorIndex : -1;
+                composite_frame(&composite);
             }
 
-            /* Sleep for the adjusted frame delay */
-            usleep(adjustedDelay * 1000);
+            gif->pendingDisposal = disposalMethod;
+            gif->pendingRect = rect;
+
+            /* Reset GCE data */
+            gif->hasGCE = 0;
 
             /* Clean up */
             if (localColorTableFlag) {
                 free(colorTable);
             }
             free(compressedData);
-            if (interlaceFlag) {
-                free(decodedPixels);
-            } else {
-                free(pixelIndices);
-            }
+            free(decodedPixels);
+
+            return 0;
 
         } else if (c == 0x21) {
             /* Extension Block */
@@ -678,47 +739,733 @@ int main(int argc, char *argv[]) {
                 fread(&terminator, 1, 1, gifFile);
 
                 /* Use delay time from GCE */
-                frameDelay = delayTime * 10; // delay in milliseconds
+                gif->frameDelay = delayTime * 10; // delay in milliseconds
 
                 /* Handle zero or very small delays */
-                if (frameDelay < 20) {
-                    frameDelay = 20; // Set minimum delay to 20ms (50 FPS)
+                if (gif->frameDelay < 20) {
+                    gif->frameDelay = 20; // Set minimum delay to 20ms (50 FPS)
                 }
 
                 /* Save GCE data for transparency */
-                gceData.disposalMethod = (packed >> 2) & 0x07;
-                gceData.transparencyFlag = packed & 0x01;
-                gceData.transparentColorIndex = transparentColorIndex;
-                hasGCE = 1;
+                gif->gceData.disposalMethod = (packed >> 2) & 0x07;
+                gif->gceData.transparencyFlag = packed & 0x01;
+                gif->gceData.transparentColorIndex = transparentColorIndex;
+                gif->hasGCE = 1;
 
             } else {
                 /* Skip other extensions */
                 skip_sub_blocks(gifFile);
             }
-        } else if (c == 0x3B) {
-            /* GIF Trailer */
-            /* Loop back to start */
-            fseek(gifFile, sizeof(GIFHeader) + sizeof(LogicalScreenDescriptor), SEEK_SET);
-            if (globalColorTableFlag) {
-                fseek(gifFile, sizeof(ColorTableEntry) * globalColorTableSize, SEEK_CUR);
-            }
         } else {
             /* Unknown block */
             fprintf(stderr, "Unknown block: 0x%X\n", c);
+            return -1;
+        }
+    }
+}
+
+/* Resize and position a frame buffer into a screen-sized image */
+void render_frame(uint8_t *frameBuffer, int gifWidth, int gifHeight,
+                  uint32_t *dst, int destWidth, int destHeight, DisplayMode mode) {
+    memset(dst, 0, destWidth * destHeight * sizeof(uint32_t)); // Clear the image
+
+    if (mode == STRETCH) {
+        /* Multithreaded bilinear interpolation */
+        pthread_t threads[NUM_THREADS];
+        ThreadData threadData[NUM_THREADS];
+        int rowsPerThread = destHeight / NUM_THREADS;
+
+        for (int i = 0; i < NUM_THREADS; i++) {
+            threadData[i].thread_id = i;
+            threadData[i].dst = dst;
+            threadData[i].frameBuffer = frameBuffer;
+            threadData[i].destWidth = destWidth;
+            threadData[i].destHeight = destHeight;
+            threadData[i].gifWidth = gifWidth;
+            threadData[i].gifHeight = gifHeight;
+            threadData[i].startRow = i * rowsPerThread;
+            threadData[i].endRow = (i == NUM_THREADS - 1) ? destHeight : threadData[i].startRow + rowsPerThread;
+            pthread_create(&threads[i], NULL, bilinear_thread_func, (void *)&threadData[i]);
+        }
+
+        /* Wait for all threads to complete */
+        for (int i = 0; i < NUM_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+    } else if (mode == CENTER) {
+        /* Center the image */
+        int offsetX = (destWidth - gifWidth) / 2;
+        int offsetY = (destHeight - gifHeight) / 2;
+        for (int y = 0; y < gifHeight; y++) {
+            for (int x = 0; x < gifWidth; x++) {
+                int srcIdx = (y * gifWidth + x) * 3;
+                uint8_t r = frameBuffer[srcIdx];
+                uint8_t g = frameBuffer[srcIdx + 1];
+                uint8_t b = frameBuffer[srcIdx + 2];
+                int dstX = x + offsetX;
+                int dstY = y + offsetY;
+                if (dstX >= 0 && dstX < destWidth && dstY >= 0 && dstY < destHeight) {
+                    int dstIdx = dstY * destWidth + dstX;
+                    dst[dstIdx] = (r << 16) | (g << 8) | b;
+                }
+            }
+        }
+    } else if (mode == TILE) {
+        /* Tile the image across the screen */
+        for (int y = 0; y < destHeight; y++) {
+            for (int x = 0; x < destWidth; x++) {
+                int srcX = x % gifWidth;
+                int srcY = y % gifHeight;
+                int srcIdx = (srcY * gifWidth + srcX) * 3;
+                uint8_t r = frameBuffer[srcIdx];
+                uint8_t g = frameBuffer[srcIdx + 1];
+                uint8_t b = frameBuffer[srcIdx + 2];
+                int dstIdx = y * destWidth + x;
+                dst[dstIdx] = (r << 16) | (g << 8) | b;
+            }
+        }
+    }
+}
+
+/* Check a file for the GIF signature */
+int is_gif_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    char signature[3];
+    int isGif = fread(signature, 1, 3, fp) == 3 && strncmp(signature, "GIF", 3) == 0;
+    fclose(fp);
+    return isGif;
+}
+
+int has_gif_extension(const char *name) {
+    size_t len = strlen(name);
+    return len >= 4 && strcasecmp(name + len - 4, ".gif") == 0;
+}
+
+/* Playlists are text, so a NUL byte near the start means some other file */
+int is_text_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    char buffer[512];
+    size_t n = fread(buffer, 1, sizeof(buffer), fp);
+    fclose(fp);
+    return memchr(buffer, '\0', n) == NULL;
+}
+
+int playlist_add(Playlist *playlist, const char *path) {
+    char **paths = realloc(playlist->paths, sizeof(char *) * (playlist->count + 1));
+    if (!paths) return -1;
+    playlist->paths = paths;
+    playlist->paths[playlist->count] = strdup(path);
+    if (!playlist->paths[playlist->count]) return -1;
+    playlist->count++;
+    return 0;
+}
+
+int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Build a playlist from a single GIF, a directory of GIFs or a playlist
+   file with one path per line ('#' starts a comment, relative paths are
+   resolved against the playlist's directory) */
+int playlist_load(Playlist *playlist, const char *path) {
+    char fullPath[PATH_MAX];
+    struct stat st;
+
+    memset(playlist, 0, sizeof(Playlist));
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (!dir) {
+            fprintf(stderr, "Could not open directory %s\n", path);
+            return -1;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (!has_gif_extension(entry->d_name)) continue;
+            if (snprintf(fullPath, sizeof(fullPath), "%s/%s", path, entry->d_name) >= (int)sizeof(fullPath)) continue;
+            if (playlist_add(playlist, fullPath) != 0) break;
+        }
+        closedir(dir);
+        qsort(playlist->paths, playlist->count, sizeof(char *), compare_paths);
+    } else if (is_gif_file(path) || has_gif_extension(path)) {
+        /* gif_open reports unreadable or invalid GIFs */
+        playlist_add(playlist, path);
+    } else if (access(path, R_OK) == 0 && !is_text_file(path)) {
+        fprintf(stderr, "Invalid GIF file %s\n", path);
+        return -1;
+    } else {
+        FILE *fp = fopen(path, "r");
+        if (!fp) {
+            fprintf(stderr, "Could not open playlist %s\n", path);
+            return -1;
+        }
+        /* Directory part of the playlist path, including the slash */
+        const char *slash = strrchr(path, '/');
+        int dirLen = slash ? (int)(slash - path + 1) : 0;
+
+        char line[PATH_MAX];
+        int readable = 0;
+        while (fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0' || line[0] == '#') continue;
+            int len;
+            if (line[0] == '/') {
+                len = snprintf(fullPath, sizeof(fullPath), "%s", line);
+            } else {
+                len = snprintf(fullPath, sizeof(fullPath), "%.*s%s", dirLen, path, line);
+            }
+            if (len >= (int)sizeof(fullPath)) continue;
+            if (access(fullPath, R_OK) == 0) readable++;
+            if (playlist_add(playlist, fullPath) != 0) break;
+        }
+        fclose(fp);
+
+        /* A text file that names no existing file is not a playlist */
+        if (playlist->count > 0 && readable == 0) {
+            fprintf(stderr, "Invalid GIF file %s\n", path);
+            return -1;
+        }
+    }
+
+    if (playlist->count == 0) {
+        fprintf(stderr, "No GIF files found in %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Remove an entry, keeping the order of the rest */
+void playlist_remove(Playlist *playlist, int index) {
+    free(playlist->paths[index]);
+    memmove(&playlist->paths[index], &playlist->paths[index + 1],
+            sizeof(char *) * (playlist->count - index - 1));
+    playlist->count--;
+}
+
+void playlist_free(Playlist *playlist) {
+    for (int i = 0; i < playlist->count; i++) {
+        free(playlist->paths[i]);
+    }
+    free(playlist->paths);
+    memset(playlist, 0, sizeof(Playlist));
+}
+
+/* Fisher-Yates shuffle of the playlist order */
+void playlist_shuffle(Playlist *playlist) {
+    for (int i = playlist->count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        char *tmp = playlist->paths[i];
+        playlist->paths[i] = playlist->paths[j];
+        playlist->paths[j] = tmp;
+    }
+}
+
+/* Thread function that opens the next GIF and pre-renders its first frame */
+void *prefetch_thread_func(void *arg) {
+    Prefetch *pf = (Prefetch *)arg;
+    int failed = 0;
+
+#ifdef __linux__
+    /* Linux applies nice values per thread; stay out of the way of playback */
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+
+    if (gif_open(&pf->gif, pf->filename, pf->cacheBudget) != 0) {
+        failed = 1;
+    } else if (gif_next_frame(&pf->gif) != 0) {
+        gif_close(&pf->gif);
+        failed = 1;
+    } else {
+        render_frame(pf->gif.frameBuffer, pf->gif.width, pf->gif.height,
+                     pf->dst, pf->destWidth, pf->destHeight, pf->mode);
+    }
+
+    pthread_mutex_lock(&pf->lock);
+    pf->failed = failed;
+    pf->done = 1;
+    pthread_mutex_unlock(&pf->lock);
+
+    return NULL;
+}
+
+int prefetch_start(Prefetch *pf, const char *filename, size_t cacheBudget) {
+    pf->filename = filename;
+    pf->cacheBudget = cacheBudget;
+    pf->done = 0;
+    pf->failed = 0;
+    if (pthread_create(&pf->thread, NULL, prefetch_thread_func, (void *)pf) != 0) {
+        fprintf(stderr, "Could not create prefetch thread\n");
+        return -1;
+    }
+    pf->active = 1;
+    return 0;
+}
+
+/* Block until the prefetch thread has finished, returns 0 if none is running */
+int prefetch_wait(Prefetch *pf) {
+    if (!pf->active) return 0;
+    pthread_join(pf->thread, NULL);
+    pf->active = 0;
+    return 1;
+}
+
+/* Returns 1 once the prefetch thread has finished and been joined */
+int prefetch_poll(Prefetch *pf) {
+    if (!pf->active) return 0;
+    pthread_mutex_lock(&pf->lock);
+    int done = pf->done;
+    pthread_mutex_unlock(&pf->lock);
+    if (!done) return 0;
+    pthread_join(pf->thread, NULL);
+    pf->active = 0;
+    return 1;
+}
+
+/* Helper function to get current time in milliseconds */
+uint64_t get_current_time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec) * 1000 + (ts.tv_nsec) / 1000000;
+}
+
+/* Create a full-screen _NET_WM_WINDOW_TYPE_DESKTOP window below all others */
+Window create_desktop_window(Display *display, Window root, XVisualInfo *vinfo, int width, int height,
+                             Colormap *colormap) {
+    XSetWindowAttributes attrs;
+    attrs.override_redirect = True;
+    attrs.background_pixel = 0;
+    attrs.border_pixel = 0;
+    attrs.colormap = XCreateColormap(display, root, vinfo->visual, AllocNone);
+    *colormap = attrs.colormap;
+    attrs.event_mask = ExposureMask;
+
+    /* Button events are not selected, so clicks propagate to the root window */
+    Window window = XCreateWindow(display, root, 0, 0, width, height, 0, vinfo->depth,
+                                  InputOutput, vinfo->visual,
+                                  CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWColormap | CWEventMask,
+                                  &attrs);
+
+    Atom windowType = XInternAtom(display, "_NET_WM_WINDOW_TYPE", False);
+    Atom desktopType = XInternAtom(display, "_NET_WM_WINDOW_TYPE_DESKTOP", False);
+    XChangeProperty(display, window, windowType, XA_ATOM, 32, PropModeReplace,
+                    (unsigned char *)&desktopType, 1);
+    XStoreName(display, window, "gifw");
+
+    XMapWindow(display, window);
+    XLowerWindow(display, window);
+    return window;
+}
+
+/* Repaint exposed areas of the desktop window from the back buffer until
+   deadline (in get_current_time_ms() time), or just drain pending events
+   when the deadline has already passed */
+void handle_events_until(Display *display, Window window, Pixmap backBuffer, GC gc, uint64_t deadline) {
+    struct pollfd pfd;
+    pfd.fd = ConnectionNumber(display);
+    pfd.events = POLLIN;
+
+    while (1) {
+        while (XPending(display)) {
+            XEvent event;
+            XNextEvent(display, &event);
+            if (event.type == Expose) {
+                XCopyArea(display, backBuffer, window, gc,
+                          event.xexpose.x, event.xexpose.y, event.xexpose.width, event.xexpose.height,
+                          event.xexpose.x, event.xexpose.y);
+            }
+        }
+        XFlush(display);
+
+        uint64_t now = get_current_time_ms();
+        if (now >= deadline) break;
+        poll(&pfd, 1, (int)(deadline - now));
+    }
+}
+
+/* Upload the parts of the image that changed since the last call to the
+   back buffer and copy them to the window, one rectangle per band of
+   DAMAGE_BAND_HEIGHT rows. presented holds the last image shown. */
+void present_damage(Display *display, Window window, Pixmap backBuffer, GC gc, XImage *ximage,
+                    uint32_t *presented, int width, int height, int fullDamage) {
+    uint32_t *dst = (uint32_t *)ximage->data;
+
+    for (int bandY = 0; bandY < height; bandY += DAMAGE_BAND_HEIGHT) {
+        int bandEnd = bandY + DAMAGE_BAND_HEIGHT < height ? bandY + DAMAGE_BAND_HEIGHT : height;
+        int minX = width, maxX = -1;
+        int minY = height, maxY = -1;
+
+        for (int y = bandY; y < bandEnd; y++) {
+            uint32_t *row = dst + y * width;
+            uint32_t *prevRow = presented + y * width;
+            int left = 0;
+            int right = width - 1;
+
+            if (!fullDamage) {
+                if (memcmp(row, prevRow, width * sizeof(uint32_t)) == 0) continue;
+                while (row[left] == prevRow[left]) left++;
+                while (row[right] == prevRow[right]) right--;
+            }
+
+            if (left < minX) minX = left;
+            if (right > maxX) maxX = right;
+            if (y < minY) minY = y;
+            maxY = y;
+            memcpy(prevRow + left, row + left, (right - left + 1) * sizeof(uint32_t));
+        }
+
+        if (maxY < 0) continue;
+
+        int damageWidth = maxX - minX + 1;
+        int damageHeight = maxY - minY + 1;
+        XPutImage(display, backBuffer, gc, ximage, minX, minY, minX, minY, damageWidth, damageHeight);
+        XCopyArea(display, backBuffer, window, gc, minX, minY, damageWidth, damageHeight, minX, minY);
+    }
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-w] [-i seconds] [-s] [-m megabytes] <gif|directory|playlist> [stretch|center|tile]\n", prog);
+    exit(1);
+}
+
+/* Main Program */
+int main(int argc, char *argv[]) {
+    int rotateInterval = DEFAULT_ROTATE_INTERVAL;
+    int shuffle = 0;
+    int useWindow = 0;
+    size_t cacheBudget = (size_t)DEFAULT_CACHE_BUDGET_MB << 20;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "wi:sm:")) != -1) {
+        switch (opt) {
+        case 'w':
+            useWindow = 1;
+            break;
+        case 'i': {
+            char *end;
+            errno = 0;
+            long seconds = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || errno == ERANGE || seconds <= 0 || seconds > INT_MAX) {
+                fprintf(stderr, "Invalid rotation interval: %s\n", optarg);
+                exit(1);
+            }
+            rotateInterval = seconds;
+            break;
+        }
+        case 's':
+            shuffle = 1;
+            break;
+        case 'm': {
+            char *end;
+            long megabytes = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || megabytes < 0) {
+                fprintf(stderr, "Invalid cache budget: %s\n", optarg);
+                exit(1);
+            }
+            cacheBudget = (size_t)megabytes << 20;
             break;
         }
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (argc - optind < 1 || argc - optind > 2) {
+        usage(argv[0]);
+    }
+
+    DisplayMode mode = STRETCH; // Default display mode
+
+    if (argc - optind == 2) {
+        const char *modeArg = argv[optind + 1];
+        if (strcmp(modeArg, "stretch") == 0) {
+            mode = STRETCH;
+        } else if (strcmp(modeArg, "center") == 0) {
+            mode = CENTER;
+        } else if (strcmp(modeArg, "tile") == 0) {
+            mode = TILE;
+        } else {
+            fprintf(stderr, "Invalid display mode. Choose from stretch, center, or tile.\n");
+            exit(1);
+        }
+    }
+
+    Playlist playlist;
+    if (playlist_load(&playlist, argv[optind]) != 0) {
+        playlist_free(&playlist);
+        exit(1);
+    }
+
+    srand(time(NULL));
+    if (shuffle) {
+        playlist_shuffle(&playlist);
+    }
+
+    GifDecoder gif;
+    int current = 0;
+    while (gif_open(&gif, playlist.paths[current], cacheBudget) != 0) {
+        if (++current == playlist.count) {
+            playlist_free(&playlist);
+            exit(1);
+        }
+    }
+
+    /* Initialize X11 */
+    Display *display = XOpenDisplay(NULL);
+    if (!display) {
+        fprintf(stderr, "Could not open X display\n");
+        gif_close(&gif);
+        playlist_free(&playlist);
+        exit(1);
+    }
+
+    int screen = DefaultScreen(display);
+    Window root = RootWindow(display, screen);
+    GC gc = DefaultGC(display, screen);
+
+    /* Get Screen Dimensions */
+    int screenWidth = DisplayWidth(display, screen);
+    int screenHeight = DisplayHeight(display, screen);
+
+    XVisualInfo vinfo;
+    if (!XMatchVisualInfo(display, screen, 24, TrueColor, &vinfo)) {
+        fprintf(stderr, "No matching visual\n");
+        XCloseDisplay(display);
+        gif_close(&gif);
+        playlist_free(&playlist);
+        exit(1);
+    }
+
+    Visual *visual = vinfo.visual;
+
+    /* Every mode renders into a screen-sized image so GIFs of
+       different sizes can share it during rotation */
+    int destWidth = screenWidth;
+    int destHeight = screenHeight;
+
+    XImage *ximage = XCreateImage(display, visual, vinfo.depth, ZPixmap, 0,
+                                  NULL, destWidth, destHeight, 32, 0);
+    if (!ximage) {
+        fprintf(stderr, "Could not create XImage\n");
+        XCloseDisplay(display);
+        gif_close(&gif);
+        playlist_free(&playlist);
+        exit(1);
+    }
+
+    ximage->data = malloc(ximage->height * ximage->bytes_per_line);
+    if (!ximage->data) {
+        fprintf(stderr, "Could not allocate memory for XImage\n");
+        XDestroyImage(ximage);
+        XCloseDisplay(display);
+        gif_close(&gif);
+        playlist_free(&playlist);
+        exit(1);
+    }
+
+    /* Desktop window output keeps a persistent back buffer and a copy of
+       the last presented image to find the damaged region */
+    Window window = None;
+    Colormap colormap = None;
+    Pixmap backBuffer = None;
+    uint32_t *presented = NULL;
+    int fullDamage = 1;
+    if (useWindow) {
+        presented = malloc(ximage->height * ximage->bytes_per_line);
+        if (!presented) {
+            fprintf(stderr, "Could not allocate memory for presented image\n");
+            XDestroyImage(ximage);
+            XCloseDisplay(display);
+            gif_close(&gif);
+            playlist_free(&playlist);
+            exit(1);
+        }
+        window = create_desktop_window(display, root, &vinfo, destWidth, destHeight, &colormap);
+        backBuffer = XCreatePixmap(display, window, destWidth, destHeight, vinfo.depth);
+
+        /* XCopyArea would otherwise get a NoExpose event back for every band */
+        XGCValues gcValues;
+        gcValues.graphics_exposures = False;
+        gc = XCreateGC(display, window, GCGraphicsExposures, &gcValues);
+
+        /* Expose events can arrive before the first frame is presented */
+        XSetForeground(display, gc, 0);
+        XFillRectangle(display, backBuffer, gc, 0, 0, destWidth, destHeight);
+    }
+
+    /* Second screen buffer the prefetch thread pre-renders into */
+    int rotating = playlist.count > 1;
+    Prefetch prefetch;
+    memset(&prefetch, 0, sizeof(Prefetch));
+    pthread_mutex_init(&prefetch.lock, NULL);
+    prefetch.destWidth = destWidth;
+    prefetch.destHeight = destHeight;
+    prefetch.mode = mode;
+    char *currentPath = playlist.paths[current];
+    int next = (current + 1) % playlist.count;
+    int prefetchFailures = 0;
+    int dropCurrent = 0;    /* current GIF failed to decode, switch as soon as possible */
+    if (rotating) {
+        prefetch.dst = malloc(ximage->height * ximage->bytes_per_line);
+        if (!prefetch.dst) {
+            fprintf(stderr, "Could not allocate memory for prefetch buffer\n");
+            rotating = 0;
+        } else if (prefetch_start(&prefetch, playlist.paths[next], cacheBudget - gif_cached_size(&gif)) != 0) {
+            rotating = 0;
+        }
+    }
+
+    /* Main Loop to Read Frames */
+    int running = 1;
+    uint64_t shownAt = get_current_time_ms();
+
+    while (running) {
+        uint64_t frameStartTime = get_current_time_ms();
+
+        if (rotating && (dropCurrent || frameStartTime - shownAt >= (uint64_t)rotateInterval * 1000) &&
+            (dropCurrent ? prefetch_wait(&prefetch) : prefetch_poll(&prefetch))) {
+            int switched = 0;
+            if (!prefetch.failed) {
+                /* Switch to the prefetched GIF, its first frame is already rendered */
+                gif_close(&gif);
+                gif = prefetch.gif;
+                memset(&prefetch.gif, 0, sizeof(GifDecoder));
+                char *shown = ximage->data;
+                ximage->data = (char *)prefetch.dst;
+                prefetch.dst = (uint32_t *)shown;
+                currentPath = playlist.paths[next];
+                shownAt = frameStartTime;
+                prefetchFailures = 0;
+                switched = 1;
+                dropCurrent = 0;
+                if (playlist.count < 2) {
+                    /* Every other entry has been dropped */
+                    rotating = 0;
+                }
+            } else if (++prefetchFailures >= playlist.count - 1) {
+                /* Nothing else in the playlist is readable */
+                rotating = 0;
+            }
+
+            if (rotating) {
+                next = (next + 1) % playlist.count;
+                if (next == 0 && shuffle) {
+                    playlist_shuffle(&playlist);
+                    /* Don't start the new lap with the GIF on screen */
+                    if (playlist.paths[0] == currentPath) {
+                        next = 1;
+                    }
+                }
+                if (prefetch_start(&prefetch, playlist.paths[next], cacheBudget - gif_cached_size(&gif)) != 0) {
+                    rotating = 0;
+                }
+            }
+
+            if (!switched) {
+                if (dropCurrent && !rotating) {
+                    /* No playable GIF left */
+                    break;
+                }
+                continue;
+            }
+        } else {
+            if (gif_next_frame(&gif) != 0) {
+                if (!rotating) {
+                    break;
+                }
+
+                /* Drop the broken entry and switch to the prefetched GIF right away */
+                fprintf(stderr, "Skipping %s\n", currentPath);
+                for (int i = 0; i < playlist.count; i++) {
+                    if (playlist.paths[i] == currentPath) {
+                        playlist_remove(&playlist, i);
+                        if (i < next) {
+                            next--;
+                        }
+                        break;
+                    }
+                }
+                currentPath = NULL;
+                gif_close(&gif);
+                dropCurrent = 1;
+                continue;
+            }
+
+            render_frame(gif.frameBuffer, gif.width, gif.height,
+                         (uint32_t *)ximage->data, destWidth, destHeight, mode);
+        }
+
+        if (useWindow) {
+            /* Drain events, repainting exposed areas from the back buffer */
+            handle_events_until(display, window, backBuffer, gc, 0);
+
+            present_damage(display, window, backBuffer, gc, ximage, presented,
+                           destWidth, destHeight, fullDamage);
+            fullDamage = 0;
+        } else {
+            /* Create pixmap from ximage */
+            Pixmap pixmap = XCreatePixmap(display, root, destWidth, destHeight, vinfo.depth);
+            XPutImage(display, pixmap, gc, ximage, 0, 0, 0, 0, destWidth, destHeight);
+
+            /* Set root window background pixmap */
+            XSetWindowBackgroundPixmap(display, root, pixmap);
+
+            /* Clear root window */
+            XClearWindow(display, root);
+
+            /* Remove old pixmap */
+            XFreePixmap(display, pixmap);
+        }
+
+        /* Flush changes */
+        XFlush(display);
+
+        /* Calculate processing time */
+        uint64_t frameEndTime = get_current_time_ms();
+        uint64_t processingTime = frameEndTime - frameStartTime;
+
+        /* Adjust frame delay */
+        int adjustedDelay = gif.frameDelay - (int)processingTime;
+        if (adjustedDelay < 0) {
+            adjustedDelay = 0; // Prevent negative delay
+        }
+
+        /* Sleep for the adjusted frame delay, the desktop window keeps
+           repainting exposed areas in the meantime */
+        if (useWindow) {
+            handle_events_until(display, window, backBuffer, gc, frameEndTime + adjustedDelay);
+        } else {
+            usleep(adjustedDelay * 1000);
+        }
     }
 
     /* Cleanup */
-    free(prevFrame);
-    free(frameBuffer);
-    free(ximage->data);
-    XDestroyImage(ximage);
-    XCloseDisplay(display);
-    fclose(gifFile);
-    if (globalColorTable) {
-        free(globalColorTable);
+    if (prefetch.active) {
+        pthread_join(prefetch.thread, NULL);
+        prefetch.active = 0;
+        if (!prefetch.failed) {
+            gif_close(&prefetch.gif);
+        }
+    }
+    pthread_mutex_destroy(&prefetch.lock);
+    free(prefetch.dst);
+    gif_close(&gif);
+    playlist_free(&playlist);
+    if (useWindow) {
+        XFreeGC(display, gc);
+        XFreePixmap(display, backBuffer);
+        XDestroyWindow(display, window);
+        XFreeColormap(display, colormap);
+        free(presented);
     }
+    XDestroyImage(ximage); // also frees ximage->data
+    XCloseDisplay(display);
 
     return 0;
 }